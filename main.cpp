@@ -7,6 +7,10 @@
 #include <fstream>
 #include <string>
 #include <algorithm>
+#include <unordered_map>
+#include <set>
+#include <cstdint>
+#include <chrono>
 
 // Forward declarations of classes to resolve circular dependencies
 class Character;
@@ -23,6 +27,534 @@ class SpellBook;
 // Global map to store pointers to the characters
 static std::map<std::string, std::shared_ptr<Character>> characters;
 
+// Codes of the errors, in the text output all of them are written as "Error caught"
+enum class ErrorCode : uint8_t {
+    UnknownCharacter = 1,   // character does not exist
+    UnknownItem      = 2,   // character does not have such item
+    NotAllowed       = 3,   // class of the character does not allow the action
+    InvalidValue     = 4,   // value of the item or length of the phrase is out of range
+    ContainerFull    = 5,   // container of the character is full
+    InvalidTarget    = 6,   // target is not in the list of allowed targets of the spell
+    InvalidEvent     = 7,   // event could not be parsed
+};
+
+// Entry of the list displayed by "Show characters"
+struct RosterEntry {
+    std::string name;
+    std::string classType;
+    int healthPoints;
+};
+
+// Entry of the list displayed by "Show weapons", "Show potions" and "Show spells"
+struct ItemEntry {
+    std::string name;
+    int value;
+};
+
+// Text representation of the entries
+std::string toText(const RosterEntry& entry) {
+    return entry.name + ":" + entry.classType + ":" + std::to_string(entry.healthPoints) + " ";
+}
+
+std::string toText(const ItemEntry& entry) {
+    return entry.name + ":" + std::to_string(entry.value) + " ";
+}
+
+// Sort entries in the order of their text representation
+template <typename Entry>
+void sortByText(std::vector<Entry>& entries) {
+    std::vector<std::pair<std::string, size_t>> keys;
+    keys.reserve(entries.size());
+    for (size_t i = 0; i < entries.size(); ++i) {
+        keys.emplace_back(toText(entries[i]), i);
+    }
+
+    sort(keys.begin(), keys.end());
+
+    std::vector<Entry> sorted;
+    sorted.reserve(entries.size());
+    for (const auto& key : keys) {
+        sorted.push_back(std::move(entries[key.second]));
+    }
+    entries = std::move(sorted);
+}
+
+// Base class for writing results of the events
+class Output {
+public:
+    virtual ~Output() = default;
+
+    virtual void error(ErrorCode code) = 0;
+    virtual void dialogue(const std::string& speaker, const std::vector<std::string>& speech) = 0;
+    virtual void newCharacter(const std::string& classType, const std::string& name) = 0;
+    virtual void newItem(const std::string& owner, const std::string& itemType, const std::string& itemName) = 0;
+    virtual void attack(const std::string& attacker, const std::string& target, const std::string& weapon, int hpDelta) = 0;
+    virtual void drink(const std::string& drinker, const std::string& potion, const std::string& supplier, int hpDelta) = 0;
+    virtual void cast(const std::string& caster, const std::string& spell, const std::string& target, int hpDelta) = 0;
+    virtual void died(const std::string& name) = 0;
+    // Display the list of the characters in sorted parts, the last part ends the list
+    virtual void showCharactersPart(const RosterEntry* entries, size_t count, bool last) = 0;
+    virtual void showItems(const std::vector<ItemEntry>& items) = 0;
+
+    void showCharacters(const std::vector<RosterEntry>& roster) {
+        showCharactersPart(roster.data(), roster.size(), true);
+    }
+};
+
+// Class for writing results of the events as the lines of the text
+class TextOutput : public Output {
+private:
+    std::ostream &outputFile;
+
+public:
+    // Constructor
+    explicit TextOutput(std::ostream &outputFile) : outputFile(outputFile) {}
+
+    void error(ErrorCode) override {
+        outputFile << "Error caught" << '\n';
+    }
+
+    void dialogue(const std::string& speaker, const std::vector<std::string>& speech) override {
+        outputFile << speaker << ": ";
+        for (const auto& s : speech) {
+            outputFile << s << " ";
+        }
+        outputFile << '\n';
+    }
+
+    void newCharacter(const std::string& classType, const std::string& name) override {
+        outputFile << "A new " << classType << " came to town, " << name << "." << '\n';
+    }
+
+    void newItem(const std::string& owner, const std::string& itemType, const std::string& itemName) override {
+        outputFile << owner << " just obtained a new " << itemType << " called " << itemName << "." << '\n';
+    }
+
+    void attack(const std::string& attacker, const std::string& target, const std::string& weapon, int) override {
+        outputFile << attacker << " attacks " << target << " with their " << weapon << "!" << '\n';
+    }
+
+    void drink(const std::string& drinker, const std::string& potion, const std::string& supplier, int) override {
+        outputFile << drinker << " drinks " << potion << " from " << supplier << "." << '\n';
+    }
+
+    void cast(const std::string& caster, const std::string& spell, const std::string& target, int) override {
+        outputFile << caster << " casts " << spell << " on " << target << "!" << '\n';
+    }
+
+    void died(const std::string& name) override {
+        outputFile << name << " has died..." << '\n';
+    }
+
+    void showCharactersPart(const RosterEntry* entries, size_t count, bool last) override {
+        for (size_t i = 0; i < count; ++i) {
+            outputFile << toText(entries[i]);
+        }
+        if (last) {
+            outputFile << '\n';
+        }
+    }
+
+    void showItems(const std::vector<ItemEntry>& items) override {
+        for (const auto& entry : items) {
+            outputFile << toText(entry);
+        }
+        outputFile << '\n';
+    }
+};
+
+// Kinds of the records in the binary output
+enum class RecordKind : uint8_t {
+    Name            = 0,    // new entry of the name dictionary, payload is the bytes of the name
+    Error           = 1,
+    Dialogue        = 2,
+    NewCharacter    = 3,
+    NewItem         = 4,
+    Attack          = 5,
+    Drink           = 6,
+    Cast            = 7,
+    Died            = 8,
+    ShowCharacters  = 9,
+    ShowItems       = 10,
+    CharactersPart  = 11,   // not last part of the list of the characters, the last part is ShowCharacters
+};
+
+// Header of the binary output: magic bytes and version of the format
+static const char BINARY_MAGIC[4] = {'M', 'F', 'S', 'B'};
+static const uint8_t BINARY_VERSION = 1;
+
+// Class for writing results of the events as binary records.
+// Every record is the kind byte, varint length of the payload and the payload.
+// Length of the payload is computed before it is written, so every record is encoded directly in the buffer.
+// Names are interned: the first use of a name writes a Name record and later records refer to it by ID,
+// integers are written as varints and HP deltas are zigzag encoded.
+class BinaryOutput : public Output {
+private:
+    std::ostream &outputFile;
+
+    // Records are encoded in place in the buffer, which is written to the file in one call when it is full
+    std::vector<char> buffer;
+
+    // Dictionary of the names and IDs of the names of the current record
+    std::unordered_map<std::string, uint32_t> names;
+    std::vector<uint32_t> ids;
+
+    static const size_t BUFFER_SIZE = 1 << 16;
+
+    void putByte(uint8_t value) { buffer.push_back(static_cast<char>(value)); }
+
+    void putVarint(uint64_t value) {
+        while (value >= 0x80) {
+            putByte(static_cast<uint8_t>(value | 0x80));
+            value >>= 7;
+        }
+        putByte(static_cast<uint8_t>(value));
+    }
+
+    static uint64_t zigzag(int64_t value) {
+        return (static_cast<uint64_t>(value) << 1) ^ static_cast<uint64_t>(value >> 63);
+    }
+
+    void putSigned(int64_t value) { putVarint(zigzag(value)); }
+
+    // Number of bytes of the encoded values
+    static size_t varintSize(uint64_t value) {
+        size_t size = 1;
+        for (value >>= 7; value != 0; value >>= 7) {
+            ++size;
+        }
+        return size;
+    }
+
+    static size_t signedSize(int64_t value) { return varintSize(zigzag(value)); }
+
+    void beginRecord(RecordKind kind, size_t length) {
+        putByte(static_cast<uint8_t>(kind));
+        putVarint(length);
+    }
+
+    void endRecord() {
+        if (buffer.size() >= BUFFER_SIZE) {
+            flush();
+        }
+    }
+
+    // Record of three names and the HP delta: attack, drink and cast
+    void putAction(RecordKind kind, const std::string& first, const std::string& second, const std::string& third, int hpDelta) {
+        uint32_t firstID = intern(first);
+        uint32_t secondID = intern(second);
+        uint32_t thirdID = intern(third);
+        beginRecord(kind, varintSize(firstID) + varintSize(secondID) + varintSize(thirdID) + signedSize(hpDelta));
+        putVarint(firstID);
+        putVarint(secondID);
+        putVarint(thirdID);
+        putSigned(hpDelta);
+        endRecord();
+    }
+
+    // Get ID of the name, writing it into the dictionary if it is new.
+    // Must be called before the record which uses the name is started
+    uint32_t intern(const std::string& name) {
+        auto found = names.find(name);
+        if (found != names.end()) {
+            return found->second;
+        }
+        uint32_t id = static_cast<uint32_t>(names.size());
+        names.emplace(name, id);
+        beginRecord(RecordKind::Name, name.size());
+        buffer.insert(buffer.end(), name.begin(), name.end());
+        endRecord();
+        return id;
+    }
+
+public:
+    // Constructor and Destructor
+    explicit BinaryOutput(std::ostream &outputFile) : outputFile(outputFile) {
+        buffer.reserve(BUFFER_SIZE);
+        buffer.insert(buffer.end(), BINARY_MAGIC, BINARY_MAGIC + sizeof(BINARY_MAGIC));
+        putByte(BINARY_VERSION);
+    }
+    ~BinaryOutput() override { flush(); }
+
+    // Write buffered records into the file
+    void flush() {
+        outputFile.write(buffer.data(), static_cast<std::streamsize>(buffer.size()));
+        buffer.clear();
+    }
+
+    void error(ErrorCode code) override {
+        beginRecord(RecordKind::Error, 1);
+        putByte(static_cast<uint8_t>(code));
+        endRecord();
+    }
+
+    void dialogue(const std::string& speaker, const std::vector<std::string>& speech) override {
+        uint32_t speakerID = intern(speaker);
+        ids.clear();
+        size_t length = varintSize(speakerID) + varintSize(speech.size());
+        for (const auto& s : speech) {
+            ids.push_back(intern(s));
+            length += varintSize(ids.back());
+        }
+        beginRecord(RecordKind::Dialogue, length);
+        putVarint(speakerID);
+        putVarint(ids.size());
+        for (uint32_t id : ids) {
+            putVarint(id);
+        }
+        endRecord();
+    }
+
+    void newCharacter(const std::string& classType, const std::string& name) override {
+        uint32_t classID = intern(classType);
+        uint32_t nameID = intern(name);
+        beginRecord(RecordKind::NewCharacter, varintSize(classID) + varintSize(nameID));
+        putVarint(classID);
+        putVarint(nameID);
+        endRecord();
+    }
+
+    void newItem(const std::string& owner, const std::string& itemType, const std::string& itemName) override {
+        uint32_t ownerID = intern(owner);
+        uint32_t typeID = intern(itemType);
+        uint32_t itemID = intern(itemName);
+        beginRecord(RecordKind::NewItem, varintSize(ownerID) + varintSize(typeID) + varintSize(itemID));
+        putVarint(ownerID);
+        putVarint(typeID);
+        putVarint(itemID);
+        endRecord();
+    }
+
+    void attack(const std::string& attacker, const std::string& target, const std::string& weapon, int hpDelta) override {
+        putAction(RecordKind::Attack, attacker, target, weapon, hpDelta);
+    }
+
+    void drink(const std::string& drinker, const std::string& potion, const std::string& supplier, int hpDelta) override {
+        putAction(RecordKind::Drink, drinker, potion, supplier, hpDelta);
+    }
+
+    void cast(const std::string& caster, const std::string& spell, const std::string& target, int hpDelta) override {
+        putAction(RecordKind::Cast, caster, spell, target, hpDelta);
+    }
+
+    void died(const std::string& name) override {
+        uint32_t nameID = intern(name);
+        beginRecord(RecordKind::Died, varintSize(nameID));
+        putVarint(nameID);
+        endRecord();
+    }
+
+    void showCharactersPart(const RosterEntry* entries, size_t count, bool last) override {
+        ids.clear();
+        size_t length = varintSize(count);
+        for (size_t i = 0; i < count; ++i) {
+            ids.push_back(intern(entries[i].name));
+            ids.push_back(intern(entries[i].classType));
+            length += varintSize(ids[ids.size() - 2]) + varintSize(ids.back()) + signedSize(entries[i].healthPoints);
+        }
+        beginRecord(last ? RecordKind::ShowCharacters : RecordKind::CharactersPart, length);
+        putVarint(count);
+        for (size_t i = 0; i < count; ++i) {
+            putVarint(ids[2 * i]);
+            putVarint(ids[2 * i + 1]);
+            putSigned(entries[i].healthPoints);
+        }
+        endRecord();
+    }
+
+    void showItems(const std::vector<ItemEntry>& items) override {
+        ids.clear();
+        size_t length = varintSize(items.size());
+        for (const auto& entry : items) {
+            ids.push_back(intern(entry.name));
+            length += varintSize(ids.back()) + signedSize(entry.value);
+        }
+        beginRecord(RecordKind::ShowItems, length);
+        putVarint(items.size());
+        for (size_t i = 0; i < items.size(); ++i) {
+            putVarint(ids[i]);
+            putSigned(items[i].value);
+        }
+        endRecord();
+    }
+};
+
+// Class for reading the binary output and replaying its records into another output
+class BinaryReader {
+private:
+    std::vector<char> data;
+    size_t position = 0;
+    size_t recordEnd = 0;
+    std::vector<std::string> names;
+
+    bool getVarint(uint64_t& value) {
+        value = 0;
+        for (int shift = 0; shift < 64; shift += 7) {
+            if (position >= recordEnd) {
+                return false;
+            }
+            auto byte = static_cast<uint8_t>(data[position++]);
+            value |= static_cast<uint64_t>(byte & 0x7F) << shift;
+            if ((byte & 0x80) == 0) {
+                return true;
+            }
+        }
+        return false;
+    }
+
+    bool getSigned(int& value) {
+        uint64_t encoded;
+        if (!getVarint(encoded)) {
+            return false;
+        }
+        value = static_cast<int>(static_cast<int64_t>(encoded >> 1) ^ -static_cast<int64_t>(encoded & 1));
+        return true;
+    }
+
+    bool getName(std::string& name) {
+        uint64_t id;
+        if (!getVarint(id) || id >= names.size()) {
+            return false;
+        }
+        name = names[id];
+        return true;
+    }
+
+    bool getNames(std::string& first, std::string& second, std::string& third) {
+        return getName(first) && getName(second) && getName(third);
+    }
+
+    // Decode payload of the record and pass it to the output
+    bool replayRecord(RecordKind kind, Output &output) {
+        std::string first, second, third;
+        int value;
+        uint64_t count;
+
+        switch (kind) {
+            case RecordKind::Name:
+                names.emplace_back(data.begin() + static_cast<std::ptrdiff_t>(position),
+                                   data.begin() + static_cast<std::ptrdiff_t>(recordEnd));
+                position = recordEnd;
+                return true;
+            case RecordKind::Error:
+                if (position >= recordEnd) {
+                    return false;
+                }
+                output.error(static_cast<ErrorCode>(data[position++]));
+                return true;
+            case RecordKind::Dialogue: {
+                if (!getName(first) || !getVarint(count)) {
+                    return false;
+                }
+                std::vector<std::string> speech(std::min<uint64_t>(count, recordEnd - position));
+                for (auto& s : speech) {
+                    if (!getName(s)) {
+                        return false;
+                    }
+                }
+                output.dialogue(first, speech);
+                return true;
+            }
+            case RecordKind::NewCharacter:
+                if (!getName(first) || !getName(second)) {
+                    return false;
+                }
+                output.newCharacter(first, second);
+                return true;
+            case RecordKind::NewItem:
+                if (!getNames(first, second, third)) {
+                    return false;
+                }
+                output.newItem(first, second, third);
+                return true;
+            case RecordKind::Attack:
+                if (!getNames(first, second, third) || !getSigned(value)) {
+                    return false;
+                }
+                output.attack(first, second, third, value);
+                return true;
+            case RecordKind::Drink:
+                if (!getNames(first, second, third) || !getSigned(value)) {
+                    return false;
+                }
+                output.drink(first, second, third, value);
+                return true;
+            case RecordKind::Cast:
+                if (!getNames(first, second, third) || !getSigned(value)) {
+                    return false;
+                }
+                output.cast(first, second, third, value);
+                return true;
+            case RecordKind::Died:
+                if (!getName(first)) {
+                    return false;
+                }
+                output.died(first);
+                return true;
+            case RecordKind::ShowCharacters:
+            case RecordKind::CharactersPart: {
+                if (!getVarint(count)) {
+                    return false;
+                }
+                std::vector<RosterEntry> roster(std::min<uint64_t>(count, recordEnd - position));
+                for (auto& entry : roster) {
+                    if (!getName(entry.name) || !getName(entry.classType) || !getSigned(entry.healthPoints)) {
+                        return false;
+                    }
+                }
+                output.showCharactersPart(roster.data(), roster.size(), kind == RecordKind::ShowCharacters);
+                return true;
+            }
+            case RecordKind::ShowItems: {
+                if (!getVarint(count)) {
+                    return false;
+                }
+                std::vector<ItemEntry> items(std::min<uint64_t>(count, recordEnd - position));
+                for (auto& entry : items) {
+                    if (!getName(entry.name) || !getSigned(entry.value)) {
+                        return false;
+                    }
+                }
+                output.showItems(items);
+                return true;
+            }
+        }
+        // Records of unknown kinds are skipped
+        position = recordEnd;
+        return true;
+    }
+
+public:
+    // Constructor
+    explicit BinaryReader(std::istream &inputFile)
+        : data(std::istreambuf_iterator<char>(inputFile), std::istreambuf_iterator<char>()) {}
+
+    // Replay all records into the output, returns false if the data is malformed
+    bool replay(Output &output) {
+        if (data.size() < sizeof(BINARY_MAGIC) + 1 ||
+            !std::equal(BINARY_MAGIC, BINARY_MAGIC + sizeof(BINARY_MAGIC), data.begin()) ||
+            static_cast<uint8_t>(data[sizeof(BINARY_MAGIC)]) != BINARY_VERSION) {
+            return false;
+        }
+        position = sizeof(BINARY_MAGIC) + 1;
+
+        while (position < data.size()) {
+            auto kind = static_cast<RecordKind>(data[position++]);
+            uint64_t length;
+            recordEnd = data.size();
+            if (!getVarint(length) || length > data.size() - position) {
+                return false;
+            }
+            recordEnd = position + length;
+            if (!replayRecord(kind, output)) {
+                return false;
+            }
+            position = recordEnd;
+        }
+        return true;
+    }
+};
+
 // Template class for physical items
 template <typename T>
 class PhysicalItem {
@@ -173,31 +705,42 @@ public:
     // Setter of the health points to the character
     void setHP(int HP) { this->healthPoints = HP; }
 
+    // Entry of the character in the list displayed by "Show characters"
+    [[nodiscard]] RosterEntry getRosterEntry() const { return {this->name, this->class_type, this->healthPoints}; }
+
+    // Find the weapon in the arsenal, nullptr if the character does not have it
+    std::shared_ptr<Weapon> findWeapon(const std::string& weaponName) {
+        auto found = this->arsenal->elements.find(weaponName);
+        return found != this->arsenal->elements.end() ? found->second : nullptr;
+    }
+
     // Attack character if it possible and write in the file
-    void attack(std::shared_ptr<Character> target, std::string weaponName, std::ofstream &outputFile) {
+    void attack(std::shared_ptr<Character> target, std::string weaponName, Output &output) {
         if (this->arsenal->elements.count(weaponName) == 0) {
-            outputFile << "Error caught" << std::endl;
+            output.error(ErrorCode::UnknownItem);
             return;
         }
-        outputFile << this->getName() << " attacks " << target->getName() << " with their " << weaponName << "!" << std::endl;
-        target->setHP(target->getHP()-this->arsenal->find(std::move(weaponName))->getDamage());
+        int damage = this->arsenal->find(weaponName)->getDamage();
+        output.attack(this->getName(), target->getName(), weaponName, -damage);
+        target->setHP(target->getHP()-damage);
     }
 
     // Attack the potion if it possible and write in the file
-    void drink(std::shared_ptr<Character> target, const std::string& potionName, std::ofstream &outputFile) {
+    void drink(std::shared_ptr<Character> target, const std::string& potionName, Output &output) {
         if (this->medicalBag->elements.count(potionName) == 0) {
-            outputFile << "Error caught" << std::endl;
+            output.error(ErrorCode::UnknownItem);
             return;
         }
-        target->setHP(target->getHP()+this->medicalBag->find(potionName)->getHealValue());
-        outputFile << target->getName() << " drinks " << potionName << " from " << this->getName() << "." << std::endl;
+        int healValue = this->medicalBag->find(potionName)->getHealValue();
+        target->setHP(target->getHP()+healValue);
+        output.drink(target->getName(), potionName, this->getName(), healValue);
         this->medicalBag->removeItem(potionName);
     }
 
     // Cast spell to the character if it possible and write in the file
-    void cast(std::shared_ptr<Character> target, const std::string& spellName, std::ofstream &outputFile) {
+    void cast(std::shared_ptr<Character> target, const std::string& spellName, Output &output) {
         if (this->spellBook->elements.count(spellName) == 0) {
-            outputFile << "Error caught" << std::endl;
+            output.error(ErrorCode::UnknownItem);
             return;
         }
         // Check allowed targets
@@ -210,73 +753,57 @@ public:
         }
         // Kill the target if it exists in the list of allowed targets
         if (_allowed_to_cast) {
+            int hpDelta = -target->getHP();
             target->setHP(0);
-            outputFile << this->getName() << " casts " << spellName << " on " << target->getName() << "!" << std::endl;
+            output.cast(this->getName(), spellName, target->getName(), hpDelta);
 
         } else {
-            outputFile << "Error caught" << std::endl;
+            output.error(ErrorCode::InvalidTarget);
             return;
         }
         this->spellBook->removeItem(spellName);
     }
 
     // Display sorted weapons of characters if it possible
-    void showArsenal(std::ofstream &outputFile) {
-
-        std::string _tempOutput_w;
-        std::vector<std::string> sorted_temp_output;
+    void showArsenal(Output &output) {
+        std::vector<ItemEntry> sorted_temp_output;
 
         for (const auto& [key, value] : this->arsenal->elements) {
-            sorted_temp_output.push_back(key + ":" + std::to_string(value->getDamage()) + " ");
-        }
-
-        sort(sorted_temp_output.begin(),sorted_temp_output.end());
-        for (const auto & i : sorted_temp_output) {
-            _tempOutput_w += i;
+            sorted_temp_output.push_back({key, value->getDamage()});
         }
 
-        outputFile << _tempOutput_w << std::endl;
+        sortByText(sorted_temp_output);
+        output.showItems(sorted_temp_output);
     }
 
     // Display sorted potions of characters if it possible
-    void showMedicalBag(std::ofstream &outputFile) {
-        std::string _tempOutput_p;
-        std::vector<std::string> sorted_temp_output;
+    void showMedicalBag(Output &output) {
+        std::vector<ItemEntry> sorted_temp_output;
 
         for (const auto& [key, value] : this->medicalBag->elements) {
-            sorted_temp_output.push_back(key + ":" + std::to_string(value->getHealValue()) + " ");
-        }
-
-        sort(sorted_temp_output.begin(),sorted_temp_output.end());
-        for (const auto & i : sorted_temp_output) {
-            _tempOutput_p += i;
+            sorted_temp_output.push_back({key, value->getHealValue()});
         }
 
-        outputFile << _tempOutput_p << std::endl;
+        sortByText(sorted_temp_output);
+        output.showItems(sorted_temp_output);
     }
 
     // Display sorted spells of characters if it possible
-    void showSpellBook(std::ofstream &outputFile) {
-
-        std::string _tempOutput_s;
-        std::vector<std::string> sorted_temp_output;
+    void showSpellBook(Output &output) {
+        std::vector<ItemEntry> sorted_temp_output;
 
         for (const auto& [key, value] : this->spellBook->elements) {
-            sorted_temp_output.push_back(key + ":" + std::to_string(value->getNumAllowedTargets()/2) + " ");
-        }
-
-        sort(sorted_temp_output.begin(),sorted_temp_output.end());
-        for (const auto & i : sorted_temp_output) {
-            _tempOutput_s += i;
+            sorted_temp_output.push_back({key, value->getNumAllowedTargets()/2});
         }
 
-        outputFile << _tempOutput_s << std::endl;
+        sortByText(sorted_temp_output);
+        output.showItems(sorted_temp_output);
     }
 
     // Function check capacity of container and add weapon into the arsenal
-    bool is_full_container_weapons(std::ofstream &outputFile, std::shared_ptr<Weapon> weapon, int max_weapons) {
+    bool is_full_container_weapons(Output &output, std::shared_ptr<Weapon> weapon, int max_weapons) {
         if (this->arsenal->elements.size() >= max_weapons)  {
-            outputFile << "Error caught" << std::endl;
+            output.error(ErrorCode::ContainerFull);
             return false;
         }
         this->arsenal->addItem(std::move(weapon));
@@ -284,9 +811,9 @@ public:
     }
 
     // Function check capacity of container and add potion into the medicalBag
-    bool is_full_container_potions(std::ofstream &outputFile, std::shared_ptr<Potion> potion, int max_potions) {
+    bool is_full_container_potions(Output &output, std::shared_ptr<Potion> potion, int max_potions) {
         if (this->medicalBag->elements.size() >= max_potions)  {
-            outputFile << "Error caught" << std::endl;
+            output.error(ErrorCode::ContainerFull);
             return false;
         }
         this->medicalBag->addItem(std::move(potion));
@@ -294,9 +821,9 @@ public:
     }
 
     // Function check capacity of container and add spell into the spellBook
-    bool is_full_container_spells(std::ofstream &outputFile, std::shared_ptr<Spell> spell, int max_spells) {
+    bool is_full_container_spells(Output &output, std::shared_ptr<Spell> spell, int max_spells) {
         if (this->spellBook->elements.size() >= max_spells)  {
-            outputFile << "Error caught" << std::endl;
+            output.error(ErrorCode::ContainerFull);
             return false;
         }
         this->spellBook->addItem(std::move(spell));
@@ -353,12 +880,8 @@ public:
 // Class for the Narrator, responsible for displaying dialogue
 class Narrator {
 public:
-    static void dialogue(const std::string& speaker, const std::vector<std::string>& speech, std::ofstream &outputFile) {
-        outputFile << speaker << ": ";
-        for (const auto& s : speech) {
-            outputFile << s << " ";
-        }
-        outputFile << std::endl;
+    static void dialogue(const std::string& speaker, const std::vector<std::string>& speech, Output &output) {
+        output.dialogue(speaker, speech);
     }
 };
 
@@ -366,52 +889,56 @@ public:
 class TextAnalyzer{
 public:
     // Processing event in the line from the file
-    static void eventProcessing(std::vector<std::string> textLine, std::ofstream &outputFile) {
-        std::string _event_type = textLine[0];
-
-        // Check present event
-        std::map<std::string, int> event;
-        event["Dialogue"]   = 0;
-        event["Create"]     = 1;
-        event["Attack"]     = 2;
-        event["Cast"]       = 3;
-        event["Drink"]      = 4;
-        event["Show"]       = 5;
-
-        switch (event[_event_type]) {
-            case 0: dialogue(textLine, outputFile); break;
-            case 1: create(textLine, outputFile);   break;
-            case 2: attack(textLine, outputFile);   break;
-            case 3: cast(textLine, outputFile);     break;
-            case 4: drink(textLine, outputFile);    break;
-            case 5: show(textLine, outputFile);     break;
+    static void eventProcessing(const std::vector<std::string>& textLine, Output &output) {
+        // Check present event, unknown events are processed as dialogue
+        static const std::map<std::string, int> event = {
+            {"Dialogue", 0},
+            {"Create",   1},
+            {"Attack",   2},
+            {"Cast",     3},
+            {"Drink",    4},
+            {"Show",     5},
+            {"Volley",   6},
+            {"Supply",   7},
+        };
+        auto _event_type = event.find(textLine[0]);
+
+        switch (_event_type != event.end() ? _event_type->second : 0) {
+            case 0: dialogue(textLine, output); break;
+            case 1: create(textLine, output);   break;
+            case 2: attack(textLine, output);   break;
+            case 3: cast(textLine, output);     break;
+            case 4: drink(textLine, output);    break;
+            case 5: show(textLine, output);     break;
+            case 6: volley(textLine, output);   break;
+            case 7: supply(textLine, output);   break;
         }
     }
 
 private:
     // Display phrase of the character
-    static void dialogue(std::vector<std::string> textLine, std::ofstream &outputFile) {
+    static void dialogue(const std::vector<std::string>& textLine, Output &output) {
         // Check existing of the character
         if (textLine[1] != "Narrator") {
             if (characters.count(textLine[1]) == 0) {
-                outputFile << "Error caught" << std::endl;
+                output.error(ErrorCode::UnknownCharacter);
                 return;
             }
         }
         // Check length of the phrase
         if (!(4 <= textLine.size() && textLine.size() <= 13)) {
-            outputFile << "Error caught" << std::endl;
+            output.error(ErrorCode::InvalidValue);
             return;
         }
 
         std::string speaker = textLine[1];
         std::vector<std::string> speech(textLine.begin() + 3, textLine.end());
 
-        Narrator::dialogue(speaker, speech, outputFile);
+        Narrator::dialogue(speaker, speech, output);
     }
 
     // Creating character or item
-    static void create(std::vector<std::string> textLine, std::ofstream &outputFile) {
+    static void create(const std::vector<std::string>& textLine, Output &output) {
         std::string _created = textLine[1];
 
         std::map <std::string, char> character;
@@ -440,7 +967,7 @@ private:
                 characters.insert({character_name, archer});
             }
 
-            outputFile << "A new " << character_class << " came to town, " << character_name << "." << std::endl;
+            output.newCharacter(character_class, character_name);
 
         } else if (_created == "item") {
             try {
@@ -455,7 +982,7 @@ private:
 
                 // Check existing of the character
                 if (characters.count(item_owner) == 0) {
-                    outputFile << "Error caught" << std::endl;
+                    output.error(ErrorCode::UnknownCharacter);
                     return;
                 }
 
@@ -476,70 +1003,70 @@ private:
                 // Create weapon, potion or spell if it possible
                 if (item[item_type] == 'w') {
                     if (owner->getClassType() == "wizard") {
-                        outputFile << "Error caught" << std::endl;
+                        output.error(ErrorCode::NotAllowed);
                         return;
                     }
                     if (!(1 <= item_unique_action_value && item_unique_action_value <= 50)) {
-                        outputFile << "Error caught" << std::endl;
+                        output.error(ErrorCode::InvalidValue);
                         return;
                     }
                     std::shared_ptr<Weapon> weapon = std::make_shared<Weapon>(item_name, item_unique_action_value);
-                    if (!owner->is_full_container_weapons(outputFile, weapon, max_weapons)) {
+                    if (!owner->is_full_container_weapons(output, weapon, max_weapons)) {
                         return;
                     }
                 } else if (item[item_type] == 'p') {
                     if (item_unique_action_value < 1) {
-                        outputFile << "Error caught" << std::endl;
+                        output.error(ErrorCode::InvalidValue);
                         return;
                     }
                     std::shared_ptr<Potion> potion = std::make_shared<Potion>(item_name, item_unique_action_value);
-                    if (!owner->is_full_container_potions(outputFile, potion, max_potions)) {
+                    if (!owner->is_full_container_potions(output, potion, max_potions)) {
                         return;
                     }
                 } else if (item[item_type] == 's') {
                     if (owner->getClassType() == "fighter") {
-                        outputFile << "Error caught" << std::endl;
+                        output.error(ErrorCode::NotAllowed);
                         return;
                     }
                     if (item_unique_action_value > 0) {
                         std::vector<std::shared_ptr<Character>> targets(item_unique_action_value);
                         for (int i = 1; i < item_unique_action_value+1; ++i) {
                             if (characters.count(textLine[5+i]) == 0) {
-                                outputFile << "Error caught" << std::endl;
+                                output.error(ErrorCode::UnknownCharacter);
                                 return;
                             }
                             targets.push_back(characters.find(textLine[5+i])->second);
                         }
                         std::shared_ptr<Spell> spell = std::make_shared<Spell>(item_name, targets);
-                        if (!owner->is_full_container_spells(outputFile, spell, max_spells)) {
+                        if (!owner->is_full_container_spells(output, spell, max_spells)) {
                             return;
                         }
                     } else if (item_unique_action_value == 0) {
                         std::vector<std::shared_ptr<Character>> targets;
                         std::shared_ptr<Spell> spell = std::make_shared<Spell>(item_name, targets);
-                        if (!owner->is_full_container_spells(outputFile, spell, max_spells)) {
+                        if (!owner->is_full_container_spells(output, spell, max_spells)) {
                             return;
                         }
                     }
 
                 }
 
-                outputFile << item_owner << " just obtained a new " << item_type << " called " << item_name << "." << std::endl;
+                output.newItem(item_owner, item_type, item_name);
 
             } catch (...) {
-                outputFile << "Error caught" << std::endl;
+                output.error(ErrorCode::InvalidEvent);
             }
         }
     }
 
     // Attack the character
-    static void attack(std::vector<std::string> textLine, std::ofstream &outputFile) {
+    static void attack(const std::vector<std::string>& textLine, Output &output) {
         std::string attackerName    = textLine[1];
         std::string targetName      = textLine[2];
         std::string weaponName      = textLine[3];
         // Check existing of attacker or target
         if (characters.count(attackerName) == 0 || characters.count(targetName) == 0) {
-            outputFile << "Error caught" << std::endl;
+            output.error(ErrorCode::UnknownCharacter);
             return;
         }
         auto attackerID             = characters.find(attackerName);
@@ -550,33 +1077,121 @@ private:
             auto target = targetID->second;
 
             if (attacker->getClassType() == "wizard") {
-                outputFile << "Error caught" << std::endl;
+                output.error(ErrorCode::NotAllowed);
                 return;
             }
             // Calling function attack and check dead the character or not
             if (attacker && target) {
-                attacker->attack(target, weaponName, outputFile);
+                attacker->attack(target, weaponName, output);
                 if (target->getHP() <= 0) {
-                    outputFile << target->getName() << " has died..." << std::endl;
+                    output.died(target->getName());
                     characters.erase(targetName);
                     target->~Character();
                     target.reset();
                 }
             }
         } else {
-            outputFile << "Error caught" << std::endl;
+            output.error(ErrorCode::UnknownCharacter);
+            return;
+        }
+    }
+
+    // Attack the list of targets by one attacker with one weapon: "Volley attacker weapon target...".
+    // Output is the same as for the sequence of "Attack attacker target weapon" events,
+    // but the attacker and the weapon are found once and the died characters are removed from the map in the end
+    static void volley(const std::vector<std::string>& textLine, Output &output) {
+        if (textLine.size() < 3) {
+            output.error(ErrorCode::InvalidEvent);
+            return;
+        }
+        std::string attackerName    = textLine[1];
+        std::string weaponName      = textLine[2];
+
+        auto attackerID             = characters.find(attackerName);
+        std::shared_ptr<Character> attacker;
+        std::shared_ptr<Weapon> weapon;
+        int damage = 0;
+        bool wizard = false;
+        if (attackerID != characters.end()) {
+            attacker = attackerID->second;
+            wizard = attacker->getClassType() == "wizard";
+            if (!wizard) {
+                weapon = attacker->findWeapon(weaponName);
+                if (weapon) {
+                    damage = weapon->getDamage();
+                }
+            }
+        }
+
+        // Names of the characters died during the volley, the attacker can die by attacking themselves
+        std::set<std::string> fallen;
+        bool attackerFallen = false;
+
+        for (size_t i = 3; i < textLine.size(); ++i) {
+            const std::string& targetName = textLine[i];
+            // Check existing of attacker or target
+            auto targetID = characters.find(targetName);
+            if (!attacker || attackerFallen || targetID == characters.end() ||
+                (!fallen.empty() && fallen.count(targetName) != 0)) {
+                output.error(ErrorCode::UnknownCharacter);
+                continue;
+            }
+            if (wizard) {
+                output.error(ErrorCode::NotAllowed);
+                continue;
+            }
+
+            Character* target = targetID->second.get();
+            if (weapon) {
+                output.attack(attackerName, targetName, weaponName, -damage);
+                target->setHP(target->getHP() - damage);
+            } else {
+                output.error(ErrorCode::UnknownItem);
+            }
+            if (target->getHP() <= 0) {
+                output.died(targetName);
+                fallen.insert(targetName);
+                attackerFallen = attackerFallen || target == attacker.get();
+            }
+        }
+
+        for (const auto& name : fallen) {
+            characters.erase(name);
+        }
+    }
+
+    // Give potions of one supplier to the list of drinkers: "Supply supplier drinker potion...".
+    // Output is the same as for the sequence of "Drink supplier drinker potion" events, but the supplier is found once
+    static void supply(const std::vector<std::string>& textLine, Output &output) {
+        if (textLine.size() < 4 || textLine.size() % 2 != 0) {
+            output.error(ErrorCode::InvalidEvent);
             return;
         }
+        auto supplierID             = characters.find(textLine[1]);
+        std::shared_ptr<Character> supplier;
+        if (supplierID != characters.end()) {
+            supplier = supplierID->second;
+        }
+
+        for (size_t i = 2; i < textLine.size(); i += 2) {
+            // Check existing of supplier or drinker
+            auto drinkerID = characters.find(textLine[i]);
+            if (!supplier || drinkerID == characters.end()) {
+                output.error(ErrorCode::UnknownCharacter);
+                continue;
+            }
+            supplier->drink(drinkerID->second, textLine[i + 1], output);
+        }
     }
 
     // Cast the spell to the character
-    static void cast(std::vector<std::string> textLine, std::ofstream &outputFile) {
+    static void cast(const std::vector<std::string>& textLine, Output &output) {
         std::string casterName  = textLine[1];
         std::string targetName  = textLine[2];
         std::string castName    = textLine[3];
         // Check existing of attacker or target
         if (characters.count(casterName) == 0 || characters.count(targetName) == 0) {
-            outputFile << "Error caught" << std::endl;
+            output.error(ErrorCode::UnknownCharacter);
             return;
         }
         auto casterID           = characters.find(casterName);
@@ -587,33 +1202,33 @@ private:
             auto target = targetID->second;
 
             if (caster->getClassType() == "fighter") {
-                outputFile << "Error caught" << std::endl;
+                output.error(ErrorCode::NotAllowed);
                 return;
             }
             // Calling function cast and kill the target
             if (caster && target) {
-                caster->cast(target, castName, outputFile);
+                caster->cast(target, castName, output);
                 if (target->getHP() <= 0) {
-                    outputFile << target->getName() << " has died..." << std::endl;
+                    output.died(target->getName());
                     characters.erase(targetName);
                     target->~Character();
                     target.reset();
                 }
             }
         } else {
-            outputFile << "Error caught" << std::endl;
+            output.error(ErrorCode::UnknownCharacter);
             return;
         }
     }
 
     // Drink the potion
-    static void drink(std::vector<std::string> textLine, std::ofstream &outputFile) {
+    static void drink(const std::vector<std::string>& textLine, Output &output) {
         std::string supplierName    = textLine[1];
         std::string drinkerName     = textLine[2];
         std::string potionName      = textLine[3];
         // Check existing of attacker or target
         if (characters.count(supplierName) == 0 || characters.count(drinkerName) == 0) {
-            outputFile << "Error caught" << std::endl;
+            output.error(ErrorCode::UnknownCharacter);
             return;
         }
         auto supplierID             = characters.find(supplierName);
@@ -624,15 +1239,15 @@ private:
             auto drinker = drinkerID->second;
 
             if (supplier && drinker) {
-                supplier->drink(drinker, potionName, outputFile);
+                supplier->drink(drinker, potionName, output);
             }
         } else {
-            outputFile << "Error caught" << std::endl;
+            output.error(ErrorCode::UnknownCharacter);
         }
     }
 
     // Display characters, weapons, potions, or spells
-    static void show(std::vector<std::string> textLine, std::ofstream &outputFile) {
+    static void show(const std::vector<std::string>& textLine, Output &output) {
         std::string type_show = textLine[1];
         // Check which type of showing was called
         std::map<std::string, char> types;
@@ -644,54 +1259,49 @@ private:
         // Check existing of the character
         if (types[type_show] != 'c') {
             if (characters.count(textLine[2]) == 0) {
-                outputFile << "Error caught" << std::endl;
+                output.error(ErrorCode::UnknownCharacter);
                 return;
             }
         }
         // Calling necessary function for display characters or items, sorting it and then display it in the file
         try {
             if (types[type_show] == 'c') {
-                std::string _tempOutput_c;
-                std::vector<std::string> sorted_temp_output;
+                std::vector<RosterEntry> sorted_temp_output;
 
                 sorted_temp_output.reserve(characters.size());
                 for (const auto& [key, value] : characters) {
-                    sorted_temp_output.push_back(key + ":" + value->getClassType() + ":" + std::to_string(value->getHP()) + " ");
-                }
-
-                sort(sorted_temp_output.begin(),sorted_temp_output.end());
-                for (const auto & i : sorted_temp_output) {
-                    _tempOutput_c += i;
+                    sorted_temp_output.push_back(value->getRosterEntry());
                 }
 
-                outputFile << _tempOutput_c << std::endl;
+                sortByText(sorted_temp_output);
+                output.showCharacters(sorted_temp_output);
 
             } else if (types[type_show] == 'w') {
                 std::string owner_weapon_name = textLine[2];
                 auto owner_w = characters.find(owner_weapon_name)->second;
                 if (owner_w->getClassType() == "wizard") {
-                    outputFile << "Error caught" << std::endl;
+                    output.error(ErrorCode::NotAllowed);
                     return;
                 }
-                owner_w->showArsenal(outputFile);
+                owner_w->showArsenal(output);
 
             } else if (types[type_show] == 'p') {
                 std::string owner_potion_name = textLine[2];
                 auto owner_p = characters.find(owner_potion_name)->second;
-                owner_p->showMedicalBag(outputFile);
+                owner_p->showMedicalBag(output);
 
             } else if (types[type_show] == 's') {
                 std::string owner_spell_name = textLine[2];
                 auto owner_s = characters.find(owner_spell_name)->second;
                 if (owner_s->getClassType() == "fighter") {
-                    outputFile << "Error caught" << std::endl;
+                    output.error(ErrorCode::NotAllowed);
                     return;
                 }
-                owner_s->showSpellBook(outputFile);
+                owner_s->showSpellBook(output);
             }
 
         } catch (...) {
-            outputFile << "Error caught" << std::endl;
+            output.error(ErrorCode::InvalidEvent);
         }
     }
 };
@@ -707,10 +1317,446 @@ std::vector<std::string> split(const std::string& s) {
     return tokens;
 }
 
-// Main function
-int main() {
+// Class of the session, interactive sessions are served before batch replays in every tick
+enum class SessionClass { Interactive, Batch };
+
+// Session processing events of its own input file with its own characters
+class Session {
+private:
+    using Clock = std::chrono::steady_clock;
+
+    SessionClass sessionClass;
+    std::ifstream inputFile;
+    std::ofstream outputFile;
+    std::unique_ptr<Output> output;
+
+    // Characters of the session, swapped with the global map while the session is running
+    std::map<std::string, std::shared_ptr<Character>> world;
+    bool finished = false;
+
+    // State of "Show characters" which is split into several steps: the characters are collected
+    // into sorted runs with their text keys, then the runs are merged and displayed in parts
+    bool showing = false;
+    bool collecting = false;
+    std::map<std::string, std::shared_ptr<Character>>::const_iterator showPosition;
+    std::vector<std::pair<std::string, RosterEntry>> keyed;
+    std::vector<std::pair<size_t, size_t>> runs;
+    std::vector<size_t> heap;
+    std::vector<RosterEntry> part;
+
+    // State of "Volley" or "Supply" which is split into pieces, the event line and the first argument of the next piece
+    bool batching = false;
+    std::vector<std::string> batchLine;
+    size_t batchHeader = 0;
+    size_t batchItem = 0;
+    size_t batchPosition = 0;
+
+    // Time when the current event became the next event of the session, latencies of the processed events
+    // and the longest step of the session
+    Clock::time_point released;
+    std::vector<std::chrono::nanoseconds> latencies;
+    Clock::duration longestStep = Clock::duration::zero();
+
+    void completeEvent() {
+        auto now = Clock::now();
+        latencies.push_back(now - released);
+        released = now;
+    }
+
+    // Collect the characters, the part collected in one step is sorted as a separate run.
+    // Collecting stops in the middle of the time left, so the sorting of the run fits into the rest
+    void collectRoster(Clock::time_point deadline) {
+        auto now = Clock::now();
+        auto collectDeadline = now < deadline ? now + (deadline - now) / 2 : deadline;
+        size_t runStart = keyed.size();
+        while (showPosition != characters.end()) {
+            for (size_t i = 0; i < CHECK_INTERVAL && showPosition != characters.end(); ++i, ++showPosition) {
+                RosterEntry entry = showPosition->second->getRosterEntry();
+                std::string key = toText(entry);
+                keyed.emplace_back(std::move(key), std::move(entry));
+            }
+            if (Clock::now() >= collectDeadline) {
+                break;
+            }
+        }
+
+        sort(keyed.begin() + static_cast<std::ptrdiff_t>(runStart), keyed.end(),
+             [](const auto& a, const auto& b) { return a.first < b.first; });
+        if (runStart < keyed.size()) {
+            runs.emplace_back(runStart, keyed.size());
+        }
+
+        if (showPosition == characters.end()) {
+            collecting = false;
+            heap.clear();
+            for (size_t run = 0; run < runs.size(); ++run) {
+                heap.push_back(run);
+            }
+            std::make_heap(heap.begin(), heap.end(), [this](size_t a, size_t b) { return laterRun(a, b); });
+        }
+    }
+
+    bool laterRun(size_t a, size_t b) const {
+        return keyed[runs[a].first].first > keyed[runs[b].first].first;
+    }
+
+    // Merge the runs and display the next parts of the list until the deadline
+    void mergeRoster(Clock::time_point deadline) {
+        auto later = [this](size_t a, size_t b) { return laterRun(a, b); };
+        do {
+            part.clear();
+            for (size_t i = 0; i < CHECK_INTERVAL && !heap.empty(); ++i) {
+                std::pop_heap(heap.begin(), heap.end(), later);
+                size_t run = heap.back();
+                // The key is not needed after the entry left the heap, it is freed here instead of all keys in the end
+                auto& [key, entry] = keyed[runs[run].first];
+                part.push_back(std::move(entry));
+                std::string().swap(key);
+                if (++runs[run].first < runs[run].second) {
+                    std::push_heap(heap.begin(), heap.end(), later);
+                } else {
+                    heap.pop_back();
+                }
+            }
+            output->showCharactersPart(part.data(), part.size(), heap.empty());
+        } while (!heap.empty() && Clock::now() < deadline);
+
+        if (heap.empty()) {
+            keyed.clear();
+            runs.clear();
+            showing = false;
+            completeEvent();
+        }
+    }
+
+    void continueShow(Clock::time_point deadline) {
+        if (collecting) {
+            collectRoster(deadline);
+        }
+        if (!collecting) {
+            mergeRoster(deadline);
+        }
+    }
+
+    // Process pieces of the batch event until the deadline. Result of the pieces is the same as of the whole event,
+    // because characters died in the previous pieces are not found in the map, as they are not attacked in the whole event
+    void continueBatch(Clock::time_point deadline) {
+        std::vector<std::string> piece(batchLine.begin(), batchLine.begin() + static_cast<std::ptrdiff_t>(batchHeader));
+        do {
+            size_t pieceEnd = std::min(batchLine.size(), batchPosition + CHECK_INTERVAL * batchItem);
+            piece.resize(batchHeader);
+            piece.insert(piece.end(), batchLine.begin() + static_cast<std::ptrdiff_t>(batchPosition),
+                         batchLine.begin() + static_cast<std::ptrdiff_t>(pieceEnd));
+            TextAnalyzer::eventProcessing(piece, *output);
+            batchPosition = pieceEnd;
+        } while (batchPosition < batchLine.size() && Clock::now() < deadline);
+
+        if (batchPosition == batchLine.size()) {
+            batchLine.clear();
+            batching = false;
+            completeEvent();
+        }
+    }
+
+    void nextEvent(Clock::time_point deadline) {
+        std::string line;
+        if (!std::getline(inputFile, line)) {
+            finished = true;
+            return;
+        }
+        std::vector<std::string> tokens = split(line);
+
+        // List of the characters is sorted and displayed in parts, so it does not stall other sessions
+        if (tokens.size() >= 2 && tokens[0] == "Show" && tokens[1] == "characters") {
+            showing = true;
+            collecting = true;
+            keyed.reserve(characters.size());
+            showPosition = characters.begin();
+            continueShow(deadline);
+            return;
+        }
+        // Long batch events are processed in pieces, incorrect ones are left to the TextAnalyzer
+        bool volley = !tokens.empty() && tokens[0] == "Volley" && tokens.size() >= 3;
+        bool supply = !tokens.empty() && tokens[0] == "Supply" && tokens.size() >= 4 && tokens.size() % 2 == 0;
+        if (volley || supply) {
+            batching = true;
+            batchLine = std::move(tokens);
+            batchHeader = volley ? 3 : 2;
+            batchItem = volley ? 1 : 2;
+            batchPosition = batchHeader;
+            continueBatch(deadline);
+            return;
+        }
+        TextAnalyzer::eventProcessing(tokens, *output);
+        completeEvent();
+    }
+
+public:
+    // Number of the characters or targets processed between the checks of the time
+    static const size_t CHECK_INTERVAL = 64;
+
+    // Constructor, output is written as binary records if the name of the file ends with ".bin"
+    Session(SessionClass sessionClass, const std::string& inputName, const std::string& outputName)
+        : sessionClass(sessionClass), inputFile(inputName) {
+        bool binary = outputName.size() >= 4 && outputName.compare(outputName.size() - 4, 4, ".bin") == 0;
+        if (binary) {
+            outputFile.open(outputName, std::ios::binary);
+            output = std::make_unique<BinaryOutput>(outputFile);
+        } else {
+            outputFile.open(outputName);
+            output = std::make_unique<TextOutput>(outputFile);
+        }
+
+        int numEvents;
+        inputFile >> numEvents;
+        inputFile.ignore();
+    }
+
+    // Getters of the state of the session
+    [[nodiscard]] SessionClass getClass() const { return this->sessionClass; }
+    [[nodiscard]] bool isFinished() const { return this->finished; }
+    [[nodiscard]] const std::vector<std::chrono::nanoseconds>& getLatencies() const { return this->latencies; }
+    [[nodiscard]] Clock::duration getLongestStep() const { return this->longestStep; }
+
+    // Start measuring latency of the first event
+    void start() { released = Clock::now(); }
+
+    // Process one event, or a part of the expensive event until the deadline.
+    // A single ordinary event is not interrupted and can end after the deadline
+    void step(Clock::time_point deadline) {
+        auto stepStart = Clock::now();
+        std::swap(characters, world);
+        if (showing) {
+            continueShow(deadline);
+        } else if (batching) {
+            continueBatch(deadline);
+        } else {
+            nextEvent(deadline);
+        }
+        std::swap(characters, world);
+        longestStep = std::max(longestStep, Clock::now() - stepStart);
+
+        if (finished) {
+            output.reset();
+            outputFile.close();
+        }
+    }
+};
+
+// Cooperative scheduler which runs sessions in ticks with the time budget per tick.
+// In every tick interactive sessions are served first, batch sessions get the rest of the budget,
+// sessions of the same class take turns by one step. Every class makes at least one step per tick
+class Scheduler {
+private:
+    std::chrono::microseconds tickBudget;
+    std::vector<std::unique_ptr<Session>> sessions;
+    std::map<SessionClass, size_t> nextSession;
+    size_t ticks = 0;
+
+    // Run steps of the sessions of the class until all of them are finished or the deadline is reached
+    void serve(SessionClass sessionClass, std::chrono::steady_clock::time_point deadline) {
+        size_t& next = nextSession[sessionClass];
+        size_t steps = 0;
+        size_t idle = 0;
+
+        while (idle < sessions.size()) {
+            if (steps > 0 && std::chrono::steady_clock::now() >= deadline) {
+                return;
+            }
+            Session& session = *sessions[next];
+            next = (next + 1) % sessions.size();
+
+            if (session.getClass() != sessionClass || session.isFinished()) {
+                ++idle;
+                continue;
+            }
+            session.step(deadline);
+            ++steps;
+            idle = 0;
+        }
+    }
+
+    static void reportClass(const std::string& className, std::vector<std::chrono::nanoseconds> latencies,
+                            std::chrono::nanoseconds longestStep, std::ostream &report) {
+        if (latencies.empty()) {
+            return;
+        }
+        sort(latencies.begin(), latencies.end());
+        auto percentile = [&latencies](double p) {
+            auto index = static_cast<size_t>(p * static_cast<double>(latencies.size() - 1));
+            return std::chrono::duration<double, std::micro>(latencies[index]).count();
+        };
+        report << className << ": events " << latencies.size()
+               << ", p50 " << percentile(0.5) << "us"
+               << ", p99 " << percentile(0.99) << "us"
+               << ", p99.9 " << percentile(0.999) << "us"
+               << ", max " << percentile(1.0) << "us"
+               << ", longest step " << std::chrono::duration<double, std::micro>(longestStep).count() << "us" << std::endl;
+    }
+
+public:
+    // Constructor
+    explicit Scheduler(std::chrono::microseconds tickBudget) : tickBudget(tickBudget) {}
+
+    void addSession(std::unique_ptr<Session> session) {
+        sessions.push_back(std::move(session));
+    }
+
+    // Run all sessions to the end
+    void run() {
+        for (auto& session : sessions) {
+            session->start();
+        }
+        while (std::any_of(sessions.begin(), sessions.end(), [](const auto& session) { return !session->isFinished(); })) {
+            auto deadline = std::chrono::steady_clock::now() + tickBudget;
+            serve(SessionClass::Interactive, deadline);
+            serve(SessionClass::Batch, deadline);
+            ++ticks;
+        }
+    }
+
+    // Display latencies of the events of every class of the sessions
+    void reportMetrics(std::ostream &report) const {
+        std::vector<std::chrono::nanoseconds> interactive;
+        std::vector<std::chrono::nanoseconds> batch;
+        std::map<SessionClass, std::chrono::nanoseconds> longestStep;
+        for (const auto& session : sessions) {
+            auto& latencies = session->getClass() == SessionClass::Interactive ? interactive : batch;
+            latencies.insert(latencies.end(), session->getLatencies().begin(), session->getLatencies().end());
+            auto& longest = longestStep[session->getClass()];
+            longest = std::max(longest, std::chrono::duration_cast<std::chrono::nanoseconds>(session->getLongestStep()));
+        }
+        report << "ticks: " << ticks << std::endl;
+        reportClass("interactive", interactive, longestStep[SessionClass::Interactive], report);
+        reportClass("batch", batch, longestStep[SessionClass::Batch], report);
+    }
+};
+
+// Compare 10^6 hits resolved by "Attack" events and by "Volley" events with the binary output
+void benchmark(std::ostream &report) {
+    const int TARGETS = 10000;
+    const int ROUNDS  = 100;
+    const int DAMAGE  = 1;
+    using Clock = std::chrono::steady_clock;
+    auto milliseconds = [](Clock::duration duration) { return std::chrono::duration<double, std::milli>(duration).count(); };
+
+    // Create the attacker with the weapon and the targets, which die in the middle of the rounds
+    auto setup = [&]() {
+        characters.clear();
+        std::ostringstream discarded;
+        TextOutput output(discarded);
+        TextAnalyzer::eventProcessing(split("Create character fighter Hero 100"), output);
+        TextAnalyzer::eventProcessing(split("Create item weapon Hero Sword " + std::to_string(DAMAGE)), output);
+        for (int i = 0; i < TARGETS; ++i) {
+            TextAnalyzer::eventProcessing(split("Create character archer T" + std::to_string(i) + " " + std::to_string(ROUNDS / 2 + i % ROUNDS)), output);
+        }
+    };
+
+    // The volley must produce the same records as the attacks
+    std::vector<std::string> names;
+    for (int i = 0; i < TARGETS; ++i) {
+        names.push_back("T" + std::to_string(i));
+    }
+
+    setup();
+    std::ostringstream attackRecords;
+    auto start = Clock::now();
+    {
+        BinaryOutput output(attackRecords);
+        std::vector<std::string> textLine = {"Attack", "Hero", "", "Sword"};
+        for (int round = 0; round < ROUNDS; ++round) {
+            for (const auto& name : names) {
+                textLine[2] = name;
+                TextAnalyzer::eventProcessing(textLine, output);
+            }
+        }
+    }
+    auto attackTime = Clock::now() - start;
+
+    setup();
+    std::ostringstream volleyRecords;
+    start = Clock::now();
+    {
+        BinaryOutput output(volleyRecords);
+        std::vector<std::string> textLine = {"Volley", "Hero", "Sword"};
+        textLine.insert(textLine.end(), names.begin(), names.end());
+        for (int round = 0; round < ROUNDS; ++round) {
+            TextAnalyzer::eventProcessing(textLine, output);
+        }
+    }
+    auto volleyTime = Clock::now() - start;
+
+    report << "events, " << ROUNDS * TARGETS << " hits: Attack " << milliseconds(attackTime)
+           << " ms, Volley " << milliseconds(volleyTime) << " ms"
+           << (attackRecords.str() == volleyRecords.str() ? "" : ", results differ") << std::endl;
+
+    characters.clear();
+}
+
+// Main function.
+// Without arguments events from input.txt are written as text into output.txt,
+// "--binary" writes them as binary records into output.bin,
+// "--decode" converts output.bin back into the text of output.txt,
+// "--sessions budget_us class:input:output..." runs several sessions with the scheduler,
+// where class is "interactive" or "batch", and displays latencies of the events,
+// "--bench" compares resolving of the hits by "Attack" and "Volley" events
+int main(int argc, char* argv[]) {
+    std::string mode = argc > 1 ? argv[1] : "";
+
+    if (mode == "--bench") {
+        benchmark(std::cout);
+        return 0;
+    }
+
+    if (mode == "--sessions") {
+        if (argc < 4) {
+            std::cerr << "Usage: --sessions budget_us class:input:output..." << std::endl;
+            return 1;
+        }
+        Scheduler scheduler(std::chrono::microseconds(std::stoll(argv[2])));
+
+        for (int i = 3; i < argc; ++i) {
+            std::string spec = argv[i];
+            size_t first = spec.find(':');
+            size_t second = spec.find(':', first == std::string::npos ? first : first + 1);
+            std::string className = spec.substr(0, first);
+            if (second == std::string::npos || (className != "interactive" && className != "batch")) {
+                std::cerr << "Invalid session " << spec << std::endl;
+                return 1;
+            }
+            SessionClass sessionClass = className == "interactive" ? SessionClass::Interactive : SessionClass::Batch;
+            scheduler.addSession(std::make_unique<Session>(sessionClass, spec.substr(first + 1, second - first - 1), spec.substr(second + 1)));
+        }
+
+        scheduler.run();
+        scheduler.reportMetrics(std::cout);
+        return 0;
+    }
+
+    if (mode == "--decode") {
+        std::ifstream binaryFile("output.bin", std::ios::binary);
+        std::ofstream outputFile("output.txt");
+        TextOutput text(outputFile);
+
+        BinaryReader reader(binaryFile);
+        if (!reader.replay(text)) {
+            std::cerr << "Malformed output.bin" << std::endl;
+            return 1;
+        }
+        return 0;
+    }
+
     std::ifstream inputFile("input.txt");
-    std::ofstream outputFile("output.txt");
+    std::ofstream outputFile;
+    std::unique_ptr<Output> output;
+
+    if (mode == "--binary") {
+        outputFile.open("output.bin", std::ios::binary);
+        output = std::make_unique<BinaryOutput>(outputFile);
+    } else {
+        outputFile.open("output.txt");
+        output = std::make_unique<TextOutput>(outputFile);
+    }
 
     std::string line;
 
@@ -721,9 +1767,11 @@ int main() {
     // Process each event in the input file
     while (std::getline(inputFile, line)) {
         std::vector<std::string> tokens = split(line);
-        TextAnalyzer::eventProcessing(tokens, outputFile);
+        TextAnalyzer::eventProcessing(tokens, *output);
     }
 
+    // Destroy the output first, so buffered records are written before closing the file
+    output.reset();
     inputFile.close();
     outputFile.close();
 